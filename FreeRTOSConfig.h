@@ -0,0 +1,41 @@
+/* FreeRTOS configuration for freertos-nested-plic-interrupt.c,
+ * HiFive1 Rev B or QEMU sifive_e (revb=true).
+ *
+ * mtime counts the 32768Hz rtc clock on both, configCPU_CLOCK_HZ is
+ * what the port divides by the tick rate to get mtimecmp increments.
+ */
+#ifndef FREERTOS_CONFIG_H
+#define FREERTOS_CONFIG_H
+
+#define configMTIME_BASE_ADDRESS		( 0x0200BFF8UL )
+#define configMTIMECMP_BASE_ADDRESS		( 0x02004000UL )
+#define configCPU_CLOCK_HZ			( ( unsigned long ) 32768 )
+#define configTICK_RATE_HZ			( ( TickType_t ) 1000 )
+
+#define configUSE_PREEMPTION			1
+#define configUSE_IDLE_HOOK			0
+/* the gpio sources are pended from the tick hook */
+#define configUSE_TICK_HOOK			1
+#define configMAX_PRIORITIES			( 5 )
+#define configMINIMAL_STACK_SIZE		( ( unsigned short ) 128 )
+#define configTOTAL_HEAP_SIZE			( ( size_t ) 6 * 1024 )
+#define configMAX_TASK_NAME_LEN			( 8 )
+#define configTICK_TYPE_WIDTH_IN_BITS		TICK_TYPE_WIDTH_32_BITS
+#define configUSE_TASK_NOTIFICATIONS		1
+#define configUSE_MUTEXES			0
+#define configUSE_TIMERS			0
+#define configUSE_TRACE_FACILITY		0
+#define configCHECK_FOR_STACK_OVERFLOW		0
+#define configSUPPORT_DYNAMIC_ALLOCATION	1
+#define configSUPPORT_STATIC_ALLOCATION		0
+
+/* nested_trap_entry pushes 80 bytes per nesting level
+ * on top of what the outermost handler uses
+ */
+#define configISR_STACK_SIZE_WORDS		( 256 )
+
+#define INCLUDE_vTaskDelay			1
+#define INCLUDE_vTaskSuspend			1
+#define INCLUDE_vTaskDelete			0
+
+#endif /* FREERTOS_CONFIG_H */
@@ -0,0 +1,135 @@
+#!/usr/bin/env python3
+# Compare the json result lines of a serial log with a stored baseline.
+#
+# Every demo prints its result as one json line. make bench-qemu and
+# make bench-compare run this with the baselines in this directory:
+#   ./bench-compare.py baseline.json new.log [tolerance_percent]
+# Fails (exit status 1) when
+#   - a baseline result is missing from the log
+#   - cycles/intr, overhead, cycles/tick, latency or below threshold
+#     count is more than tolerance_percent (default 5) above baseline
+#   - intr_count is off the baseline by more than tolerance_percent
+#     either way, or 0 where the baseline has none yet
+#   - nesting_depth is below baseline
+# Baseline values that are null are not compared, a baseline with
+# "placeholder": true holds only what is known without a board run.
+# With --strict (make bench-qemu) a placeholder baseline and a result
+# with no baseline fail too.
+#
+#   ./bench-compare.py --save new.log > baseline.json
+# makes a baseline from a log.
+import json
+import sys
+
+# all of these are better when lower
+METRICS = ("cycles_per_intr", "overhead_permille", "cycles_per_tick",
+           "latency_avg", "latency_max", "below_threshold_count")
+# what tells one case from another
+KEY = ("demo", "source", "freq")
+
+
+def key(r):
+    return json.dumps([r.get(k) for k in KEY])
+
+
+def log_results(path):
+    res = {}
+    with open(path, errors="replace") as f:
+        for line in f:
+            line = line.strip()
+            if not line.startswith("{"):
+                continue
+            try:
+                r = json.loads(line)
+            except ValueError:
+                continue
+            if "demo" in r:
+                res[key(r)] = r
+    return res
+
+
+def baseline(path):
+    with open(path) as f:
+        b = json.load(f)
+    return b.get("placeholder", False), {key(r): r for r in b["results"]}
+
+
+def values(v):
+    return v if isinstance(v, list) else [v]
+
+
+def compare(b, r, tolerance):
+    bad = []
+
+    def fail(metric, bv, nv):
+        bad.append({"demo": r["demo"], "source": r.get("source"),
+                    "freq": r.get("freq"), "metric": metric,
+                    "baseline": bv, "new": nv, "status": "regression"})
+
+    for m in METRICS:
+        if b.get(m) is None or m not in r:
+            continue
+        for nv, bv in zip(values(r[m]), values(b[m])):
+            if bv is not None and nv > bv * (1 + tolerance / 100):
+                fail(m, bv, nv)
+
+    bv, nv = b.get("intr_count"), r.get("intr_count", 0)
+    if bv is None:
+        if nv == 0:
+            fail("intr_count", bv, nv)
+    elif abs(nv - bv) > max(1, bv * tolerance / 100):
+        fail("intr_count", bv, nv)
+
+    bv, nv = b.get("nesting_depth"), r.get("nesting_depth", 0)
+    if bv is not None and nv < bv:
+        fail("nesting_depth", bv, nv)
+    return bad
+
+
+def main():
+    args = sys.argv[1:]
+    strict = len(args) > 0 and args[0] == "--strict"
+    if strict:
+        args = args[1:]
+    if len(args) == 2 and args[0] == "--save":
+        res = sorted(log_results(args[1]).values(), key=key)
+        if not res:
+            sys.stderr.write("no results in %s\n" % args[1])
+            return 1
+        print(json.dumps({"placeholder": False, "results": res}, indent=1))
+        return 0
+    if len(args) not in (2, 3):
+        print("usage: %s [--strict] baseline.json new.log [tolerance_percent]\n"
+              "       %s --save new.log" % (sys.argv[0], sys.argv[0]))
+        return 2
+    tolerance = float(args[2]) if len(args) == 3 else 5.0
+    placeholder, base = baseline(args[0])
+    new = log_results(args[1])
+    report = []
+
+    if placeholder and strict:
+        sys.stderr.write("%s is a placeholder, make one with "
+                         "--save first\n" % args[0])
+        return 1
+    if placeholder:
+        sys.stderr.write("%s is a placeholder, its null values are "
+                         "not compared\n" % args[0])
+    for k, b in sorted(base.items()):
+        r = new.get(k)
+        if r is None:
+            report.append({"demo": b["demo"], "source": b.get("source"),
+                           "freq": b.get("freq"), "status": "missing"})
+            continue
+        report += compare(b, r, tolerance)
+    for k in sorted(set(new) - set(base)):
+        r = new[k]
+        report.append({"demo": r["demo"], "source": r.get("source"),
+                       "freq": r.get("freq"), "status": "no baseline"})
+    regressed = any(strict or r["status"] != "no baseline" for r in report)
+
+    print(json.dumps(report, indent=1))
+    return 1 if regressed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
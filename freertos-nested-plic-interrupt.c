@@ -0,0 +1,525 @@
+/* This program is the FreeRTOS version of nested-plic-interrupt.c,
+ * plus an IntQueue-like benchmark to compare with it.
+ *
+ * Needs FreeRTOS kernel V11 RISC-V port (freertos_risc_v_trap_handler
+ * installed as mtvec, external interrupts passed on to
+ * freertos_risc_v_application_interrupt_handler) with freedom metal
+ * and FreeRTOSConfig.h next to this file.
+ * configISR_STACK_SIZE_WORDS should leave room for a few nested frames.
+ *
+ * pwm1.pwmcmp0ip asserts interrupt level to PLIC gateway 4000 times/second.
+ * pwm2.pwmcmp0ip asserts interrupt level to PLIC gateway 1009 times/second.
+ * (defaults of PWM1_FREQ, PWM2_FREQ)
+ * The later is the higher priority source to PLIC.
+ *
+ * QEMU sifive_e leaves the pwm blocks unimplemented. Built with
+ * -DGPIO_SOURCES=1 the two sources are gpio pins 2 and 3 (PLIC source
+ * 10 and 11) instead, with the same priorities. The tick hook makes a
+ * rising edge on pin 2 every tick and the isr of pin 2 makes one on
+ * pin 3, which then nests. This runs on QEMU and on the board.
+ *
+ * The port's trap handler saves the task context, stores sp into
+ * pxCurrentTCB and switches to the ISR stack every time it is entered,
+ * so it must not be entered again while an interrupt is being handled.
+ * new_plic_handler raises PLIC threshold as before, but points mtvec
+ * to nested_trap_entry before setting mstatus.MIE, which only saves
+ * caller saved regs, mepc and mstatus on the ISR stack already in use.
+ * mie.MTIE is cleared meanwhile so only external intr can nest, the
+ * tick is taken after the outermost handler returns.
+ *
+ * isrs wake their task by direct to task notification. Whether a switch
+ * is needed is collected over all nesting levels and vTaskSwitchContext
+ * is called once when the outermost handler is done, the new task is
+ * restored by the port on trap exit.
+ *
+ * meas_task runs the same mcycle loop as nested-plic-interrupt.c at the
+ * lowest priority, twice. The first time the two sources are disabled
+ * in PLIC so only the tick counts as intr, that gives cycles/tick.
+ * The second time the ticks are taken out again, what is left is the
+ * isrs and the handler tasks. source_task records mcycle from its isr
+ * to its wakeup over the whole run, nested-plic-interrupt.c does the
+ * same from its isrs to the outermost handler returning.
+ *
+ * For comparison build nested-plic-interrupt.c with the same
+ * PWM1_FREQ/PWM2_FREQ or GPIO_SOURCES (make bench does). The last line
+ * printed is the result as json for bench-compare.py.
+ */
+#include <stdio.h>
+#include <metal/machine.h>
+#include <metal/machine/platform.h>
+#include "FreeRTOS.h"
+#include "task.h"
+
+#ifndef GPIO_SOURCES
+#define GPIO_SOURCES 0
+#endif
+#ifndef PWM1_FREQ
+#define PWM1_FREQ 4000
+#endif
+#ifndef PWM2_FREQ
+#define PWM2_FREQ 1009
+#endif
+#ifndef LOOP_COUNT
+#define LOOP_COUNT 1000000
+#endif
+
+#define GPIO_PIN1 2
+#define GPIO_PIN2 3
+
+struct intr_source {
+	struct metal_pwm *pwm;
+	int gpio_pin;
+	int plic_id;
+	TaskHandle_t task;
+	/* mcycle when the isr was entered */
+	volatile unsigned stamp;
+	volatile unsigned intr_count;
+	unsigned wakeups;
+	unsigned latency_max;
+	unsigned long long latency_sum;
+};
+
+struct metal_interrupt *plic;
+struct intr_source intr_sources[2];
+
+int nesting_depth = 0;
+int nesting_depth_max = 0;
+BaseType_t switch_required = pdFALSE;
+
+void freertos_risc_v_trap_handler(void);
+void nested_trap_entry(void);
+
+/* only used while an external interrupt is being handled, see above */
+__asm__(
+	".section .text\n"
+	".align 4\n"
+	".global nested_trap_entry\n"
+	"nested_trap_entry:\n"
+	"	addi sp, sp, -80\n"
+	"	sw ra, 0(sp)\n"
+	"	sw t0, 4(sp)\n"
+	"	sw t1, 8(sp)\n"
+	"	sw t2, 12(sp)\n"
+	"	sw a0, 16(sp)\n"
+	"	sw a1, 20(sp)\n"
+	"	sw a2, 24(sp)\n"
+	"	sw a3, 28(sp)\n"
+	"	sw a4, 32(sp)\n"
+	"	sw a5, 36(sp)\n"
+	"	sw a6, 40(sp)\n"
+	"	sw a7, 44(sp)\n"
+	"	sw t3, 48(sp)\n"
+	"	sw t4, 52(sp)\n"
+	"	sw t5, 56(sp)\n"
+	"	sw t6, 60(sp)\n"
+	"	csrr t0, mepc\n"
+	"	sw t0, 64(sp)\n"
+	"	csrr t0, mstatus\n"
+	"	sw t0, 68(sp)\n"
+	"	csrr a0, mcause\n"
+	"	call nested_trap_handler\n"
+	"	lw t0, 68(sp)\n"
+	"	csrw mstatus, t0\n"
+	"	lw t0, 64(sp)\n"
+	"	csrw mepc, t0\n"
+	"	lw ra, 0(sp)\n"
+	"	lw t0, 4(sp)\n"
+	"	lw t1, 8(sp)\n"
+	"	lw t2, 12(sp)\n"
+	"	lw a0, 16(sp)\n"
+	"	lw a1, 20(sp)\n"
+	"	lw a2, 24(sp)\n"
+	"	lw a3, 28(sp)\n"
+	"	lw a4, 32(sp)\n"
+	"	lw a5, 36(sp)\n"
+	"	lw a6, 40(sp)\n"
+	"	lw a7, 44(sp)\n"
+	"	lw t3, 48(sp)\n"
+	"	lw t4, 52(sp)\n"
+	"	lw t5, 56(sp)\n"
+	"	lw t6, 60(sp)\n"
+	"	addi sp, sp, 80\n"
+	"	mret\n"
+);
+
+void new_plic_handler(void)
+{
+	struct __metal_driver_riscv_plic0 *plic0 =
+		(struct __metal_driver_riscv_plic0 *)plic;
+
+	/* interrupt claim process to PLIC */
+	volatile unsigned *plic_claim_addr = (unsigned *)0xc200004U;
+	unsigned plic_source = *plic_claim_addr;
+	if (plic_source == 0)
+		return;
+
+	nesting_depth++;
+	if (nesting_depth > nesting_depth_max)
+		nesting_depth_max = nesting_depth;
+
+	/* keep later traps away from freertos_risc_v_trap_handler
+	 * and the tick away until the outermost handler is done
+	 */
+	unsigned mie_MTIE = 0x80, mie_saved = 0;
+	if (nesting_depth == 1) {
+		__asm__ volatile("csrw mtvec, %0" :: "r"(nested_trap_entry));
+		__asm__ volatile("csrrc %0, mie, %1" : "=r"(mie_saved) : "r"(mie_MTIE));
+	}
+
+	/* get the PLIC priority assigned to this source */
+	unsigned plic_source_priority = metal_interrupt_get_priority(plic, plic_source);
+
+	/* get current priority threshold in PLIC for later restore */
+	unsigned plic_threshold = metal_interrupt_get_threshold(plic);
+
+	/* rise priority threshold in PLIC */
+	metal_interrupt_set_threshold(plic, plic_source_priority);
+
+	/* globally enable interrupt again */
+	unsigned mstatus_MIE = 8;
+	__asm__ volatile("csrs mstatus, %0" :: "r"(mstatus_MIE));
+
+	/* find source specific isr in the table and call it */
+	void (*plic_source_isr)(int, void *) = (void(*)(int, void *))0;
+	if (plic_source < 53)
+		plic_source_isr = plic0->metal_exint_table[plic_source];
+	if (plic_source_isr)
+		plic_source_isr(plic_source, plic0->metal_exdata_table[plic_source].exint_data);
+
+	/* globally disable interrupt */
+	__asm__ volatile("csrc mstatus, %0" :: "r"(mstatus_MIE));
+
+	/* restore priority threshold in PLIC */
+	metal_interrupt_set_threshold(plic, plic_threshold);
+
+	/* interrupt complete process to PLIC */
+	*plic_claim_addr = plic_source;
+
+	if (nesting_depth == 1) {
+		__asm__ volatile("csrs mie, %0" :: "r"(mie_saved & mie_MTIE));
+		__asm__ volatile("csrw mtvec, %0" :: "r"(freertos_risc_v_trap_handler));
+	}
+	nesting_depth--;
+}
+
+void nested_trap_handler(unsigned mcause)
+{
+	/* only machine external interrupt is enabled while nesting */
+	if ((mcause & 0x7fffffffU) != 11)
+		while (1) ;
+	new_plic_handler();
+}
+
+void freertos_risc_v_application_interrupt_handler(uint32_t mcause)
+{
+	if ((mcause & 0x7fffffffU) != 11)
+		while (1) ;
+	new_plic_handler();
+
+	/* deferred, the port switches to pxCurrentTCB on trap exit */
+	if (switch_required != pdFALSE) {
+		switch_required = pdFALSE;
+		portYIELD_FROM_ISR(pdTRUE);
+	}
+}
+
+void notify_task(struct intr_source *src)
+{
+	BaseType_t woken = pdFALSE;
+	unsigned mstatus, mstatus_MIE = 8;
+
+	/* FromISR APIs don't mask interrupts in this port as it
+	 * doesn't expect nesting, so keep a nested isr out by hand
+	 */
+	__asm__ volatile("csrrc %0, mstatus, %1" : "=r"(mstatus) : "r"(mstatus_MIE));
+	vTaskNotifyGiveFromISR(src->task, &woken);
+	if (woken != pdFALSE)
+		switch_required = pdTRUE;
+	__asm__ volatile("csrs mstatus, %0" :: "r"(mstatus & mstatus_MIE));
+}
+
+#if GPIO_SOURCES
+void gpiox_isr(int id, void *data)
+{
+	struct intr_source *src = data;
+	volatile unsigned *gpio_output_val = (unsigned *)0x1001200cU;
+	volatile unsigned *gpio_rise_ip = (unsigned *)0x1001201cU;
+	unsigned mstatus, mstatus_MIE = 8;
+
+	__asm__ volatile("csrr %0, mcycle" : "=r"(src->stamp));
+
+	/* pin low again and clear rise_ip, pin 2 also pends pin 3.
+	 * output_val is read-modify-write, keep pin 3's isr out
+	 */
+	__asm__ volatile("csrrc %0, mstatus, %1" : "=r"(mstatus) : "r"(mstatus_MIE));
+	*gpio_output_val &= ~(1U << src->gpio_pin);
+	*gpio_rise_ip = 1U << src->gpio_pin;
+	if (src->gpio_pin == GPIO_PIN1)
+		*gpio_output_val |= 1U << GPIO_PIN2;
+	__asm__ volatile("csrs mstatus, %0" :: "r"(mstatus & mstatus_MIE));
+
+	src->intr_count++;
+	notify_task(src);
+}
+#else
+void pwmx_isr0(int pwm_id, void *data)
+{
+	struct intr_source *src = data;
+
+	__asm__ volatile("csrr %0, mcycle" : "=r"(src->stamp));
+
+	/* clear pwmx.pwmcmp0ip */
+	metal_pwm_clr_interrupt(src->pwm, 0);
+	src->intr_count++;
+	notify_task(src);
+}
+#endif
+
+/* needs configUSE_TICK_HOOK */
+void vApplicationTickHook(void)
+{
+#if GPIO_SOURCES
+	/* rising edge on pin 2 */
+	volatile unsigned *gpio_output_val = (unsigned *)0x1001200cU;
+	*gpio_output_val |= 1U << GPIO_PIN1;
+#endif
+}
+
+void source_task(void *param)
+{
+	struct intr_source *src = param;
+	unsigned now, latency;
+
+	while (1) {
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		__asm__ volatile("csrr %0, mcycle" : "=r"(now));
+		/* notifications may be merged, measure from the latest isr */
+		latency = now - src->stamp;
+		src->wakeups++;
+		src->latency_sum += latency;
+		if (latency > src->latency_max)
+			src->latency_max = latency;
+	}
+}
+
+/* same loop as nested-plic-interrupt.c */
+void count_mcycle(int *intr, int *non_intr)
+{
+	int i, i_saved;
+	int count_intr = 0, count_non_intr = 0;
+	int while_count = LOOP_COUNT;
+
+	__asm__ volatile("csrr %0, mcycle" : "=r"(i_saved));
+	while (while_count-- > 0) {
+		__asm__ volatile("csrr %0, mcycle" : "=r"(i));
+		if (i - i_saved > 50) {
+			count_intr += i - i_saved;
+		} else {
+			count_non_intr += i - i_saved;
+		}
+		i_saved = i;
+	}
+	*intr = count_intr;
+	*non_intr = count_non_intr;
+}
+
+void meas_task(void *param)
+{
+	int count_intr, count_non_intr;
+	unsigned intr_count[2], intr_total;
+	unsigned wakeups[2], latency_max[2];
+	unsigned long long latency_sum[2];
+	unsigned latency_avg[2] = {0, 0};
+	unsigned tick_count, cycles_per_tick, tick_cycles, src_cycles;
+	TickType_t ticks;
+	int n;
+
+	/* let the handler tasks block on their notification first */
+	vTaskDelay(1);
+
+	/* tick only */
+	ticks = xTaskGetTickCount();
+	count_mcycle(&count_intr, &count_non_intr);
+	tick_count = xTaskGetTickCount() - ticks;
+	cycles_per_tick = tick_count ? (unsigned)count_intr / tick_count : 0;
+
+	for (n = 0; n < 2; n++)
+		intr_count[n] = intr_sources[n].intr_count;
+	for (n = 0; n < 2; n++)
+		metal_interrupt_enable(plic, intr_sources[n].plic_id);
+
+	ticks = xTaskGetTickCount();
+	count_mcycle(&count_intr, &count_non_intr);
+	tick_count = xTaskGetTickCount() - ticks;
+
+	/* stop the sources before looking at what the handler tasks
+	 * recorded, they have higher priority so anything notified
+	 * before this has been handled when we get here
+	 */
+	for (n = 0; n < 2; n++)
+		metal_interrupt_disable(plic, intr_sources[n].plic_id);
+	taskENTER_CRITICAL();
+	for (n = 0; n < 2; n++) {
+		intr_count[n] = intr_sources[n].intr_count - intr_count[n];
+		wakeups[n] = intr_sources[n].wakeups;
+		latency_max[n] = intr_sources[n].latency_max;
+		latency_sum[n] = intr_sources[n].latency_sum;
+	}
+	taskEXIT_CRITICAL();
+
+	intr_total = intr_count[0] + intr_count[1];
+	tick_cycles = tick_count * cycles_per_tick;
+	src_cycles = (unsigned)count_intr > tick_cycles ?
+		(unsigned)count_intr - tick_cycles : 0;
+
+	printf("intr: %d\r\nnon_intr: %d\r\n", count_intr, count_non_intr);
+	printf("tick: %u cycles/tick: %u\r\n", tick_count, cycles_per_tick);
+	if (intr_total)
+		printf("cycles/intr: %u\r\n", src_cycles / intr_total);
+	printf("max nesting depth: %d\r\n", nesting_depth_max);
+	for (n = 0; n < 2; n++) {
+		if (wakeups[n] == 0)
+			continue;
+		latency_avg[n] = (unsigned)(latency_sum[n] / wakeups[n]);
+		printf("source%d intr: %u wakeups: %u latency avg: %u max: %u\r\n",
+			n + 1, intr_count[n], wakeups[n],
+			latency_avg[n], latency_max[n]);
+	}
+	printf("{\"demo\": \"freertos-nested-plic-interrupt\", "
+		"\"source\": \"%s\", \"freq\": [%d, %d], \"intr_count\": %u, "
+		"\"cycles_per_intr\": %u, \"overhead_permille\": %u, "
+		"\"tick_count\": %u, \"cycles_per_tick\": %u, "
+		"\"nesting_depth\": %d, \"wakeups\": [%u, %u], "
+		"\"latency_avg\": [%u, %u], \"latency_max\": [%u, %u]}\r\n",
+#if GPIO_SOURCES
+		"gpio", configTICK_RATE_HZ, configTICK_RATE_HZ,
+#else
+		"pwm", PWM1_FREQ, PWM2_FREQ,
+#endif
+		intr_total, intr_total ? src_cycles / intr_total : 0,
+		(unsigned)((unsigned long long)src_cycles * 1000 /
+			((unsigned)count_intr + (unsigned)count_non_intr)),
+		tick_count, cycles_per_tick,
+		nesting_depth_max, wakeups[0], wakeups[1],
+		latency_avg[0], latency_avg[1],
+		latency_max[0], latency_max[1]);
+
+	vTaskSuspend(NULL);
+}
+
+int main(void)
+{
+	struct metal_cpu *cpu;
+	struct metal_interrupt *cpu_intr;
+	int rc;
+
+	cpu = metal_cpu_get(metal_cpu_get_current_hartid());
+	if (cpu == NULL)
+		return 1;
+	cpu_intr = metal_cpu_interrupt_controller(cpu);
+	if (cpu_intr == NULL)
+		return 1;
+	metal_interrupt_init(cpu_intr);
+
+	plic = metal_interrupt_get_controller(METAL_PLIC_CONTROLLER, 0);
+	if (plic == NULL)
+		return 1;
+	metal_interrupt_init(plic);
+
+	/* metal set mtvec to its own vector above, FreeRTOS
+	 * takes all traps and hands the external one to us
+	 */
+	__asm__ volatile("csrw mtvec, %0" :: "r"(freertos_risc_v_trap_handler));
+	unsigned mie_MEIE = 0x800;
+	__asm__ volatile("csrs mie, %0" :: "r"(mie_MEIE));
+
+#if GPIO_SOURCES
+	volatile unsigned *gpio_input_en = (unsigned *)0x10012004U;
+	volatile unsigned *gpio_output_en = (unsigned *)0x10012008U;
+	volatile unsigned *gpio_output_val = (unsigned *)0x1001200cU;
+	volatile unsigned *gpio_rise_ie = (unsigned *)0x10012018U;
+	volatile unsigned *gpio_rise_ip = (unsigned *)0x1001201cU;
+	unsigned pins = (1U << GPIO_PIN1) | (1U << GPIO_PIN2);
+
+	/* both input and output so the pin value reads back */
+	*gpio_output_val &= ~pins;
+	*gpio_input_en |= pins;
+	*gpio_output_en |= pins;
+	*gpio_rise_ip = pins;
+	*gpio_rise_ie |= pins;
+
+	/* gpio0 is source 8 for PLIC */
+	intr_sources[0].gpio_pin = GPIO_PIN1;
+	intr_sources[0].plic_id = 8 + GPIO_PIN1;
+	rc = metal_interrupt_register_handler(plic, intr_sources[0].plic_id,
+			gpiox_isr, &intr_sources[0]);
+	if (rc)
+		return 1;
+	intr_sources[1].gpio_pin = GPIO_PIN2;
+	intr_sources[1].plic_id = 8 + GPIO_PIN2;
+	rc = metal_interrupt_register_handler(plic, intr_sources[1].plic_id,
+			gpiox_isr, &intr_sources[1]);
+	if (rc)
+		return 1;
+#else
+	struct metal_pwm *pwm1, *pwm2;
+
+	pwm1 = metal_pwm_get_device(1);
+	if (pwm1 == NULL)
+		return 1;
+	intr_sources[0].pwm = pwm1;
+	intr_sources[0].plic_id = metal_pwm_get_interrupt_id(pwm1, 0);	/* source 44 for PLIC */
+	rc = metal_interrupt_register_handler(plic, intr_sources[0].plic_id,
+			pwmx_isr0, &intr_sources[0]);
+	if (rc)
+		return 1;
+
+	pwm2 = metal_pwm_get_device(2);
+	if (pwm2 == NULL)
+		return 1;
+	intr_sources[1].pwm = pwm2;
+	intr_sources[1].plic_id = metal_pwm_get_interrupt_id(pwm2, 0);	/* source 48 for PLIC */
+	rc = metal_interrupt_register_handler(plic, intr_sources[1].plic_id,
+			pwmx_isr0, &intr_sources[1]);
+	if (rc)
+		return 1;
+#endif
+	metal_interrupt_set_priority(plic, intr_sources[0].plic_id, 2);
+	metal_interrupt_set_priority(plic, intr_sources[1].plic_id, 5);
+
+	if (xTaskCreate(source_task, "src1", configMINIMAL_STACK_SIZE, &intr_sources[0],
+			configMAX_PRIORITIES - 2, &intr_sources[0].task) != pdPASS)
+		return 1;
+	if (xTaskCreate(source_task, "src2", configMINIMAL_STACK_SIZE, &intr_sources[1],
+			configMAX_PRIORITIES - 1, &intr_sources[1].task) != pdPASS)
+		return 1;
+	if (xTaskCreate(meas_task, "meas", configMINIMAL_STACK_SIZE * 4, NULL,
+			tskIDLE_PRIORITY + 1, NULL) != pdPASS)
+		return 1;
+
+#if !GPIO_SOURCES
+	metal_pwm_enable(pwm1);
+	metal_pwm_set_freq(pwm1, 0, PWM1_FREQ);
+	metal_pwm_set_duty(pwm1, 1, 0, METAL_PWM_PHASE_CORRECT_DISABLE);
+	metal_pwm_set_duty(pwm1, 2, 0, METAL_PWM_PHASE_CORRECT_DISABLE);
+	metal_pwm_set_duty(pwm1, 3, 0, METAL_PWM_PHASE_CORRECT_DISABLE);
+
+	metal_pwm_enable(pwm2);
+	metal_pwm_set_freq(pwm2, 0, PWM2_FREQ);
+	metal_pwm_set_duty(pwm2, 1, 0, METAL_PWM_PHASE_CORRECT_DISABLE);
+	metal_pwm_set_duty(pwm2, 2, 0, METAL_PWM_PHASE_CORRECT_DISABLE);
+	metal_pwm_set_duty(pwm2, 3, 0, METAL_PWM_PHASE_CORRECT_DISABLE);
+
+	metal_pwm_trigger(pwm1, 0, METAL_PWM_CONTINUOUS);
+	metal_pwm_cfg_interrupt(pwm1, METAL_PWM_INTERRUPT_ENABLE);
+
+	metal_pwm_trigger(pwm2, 0, METAL_PWM_CONTINUOUS);
+	metal_pwm_cfg_interrupt(pwm2, METAL_PWM_INTERRUPT_ENABLE);
+#endif
+
+	/* the sources are enabled in PLIC by meas_task,
+	 * mstatus.MIE is set when the first task starts
+	 */
+	vTaskStartScheduler();
+	return 2;
+}
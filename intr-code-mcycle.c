@@ -6,19 +6,123 @@
  * (With some higher interrupt rates when testing FreeRTOS using 
  * IntQueue tasks I saw most of the time is used for interrupt thing. 
  * So want to see some quantitative result with simpler demo first.)
+ *
+ * The number of interrupts and the cycles from isr to the main loop
+ * running again are also counted. Only the end of each intr gap and
+ * the isr stamp are kept inside the loop, the rest is done after it.
+ *
+ * Build with -DPWM1_FREQ=n to run at another interrupt rate. The last
+ * line printed is the result as json for bench-compare.py.
+ *
+ * QEMU sifive_e leaves the pwm blocks unimplemented. Built with
+ * -DGPIO_SOURCES=1 the source is gpio pin 2 (PLIC source 10) instead,
+ * the machine timer makes a rising edge on it GPIO_FREQ times/second.
+ * The loop then first runs with only the timer enabled and cycles/tick
+ * is taken out of the intr cycles like in nested-plic-interrupt.c.
  */
 #include <stdio.h>
 #include <metal/machine.h>
 #include <metal/machine/platform.h>
+#include <metal/timer.h>
+
+#ifndef GPIO_SOURCES
+#define GPIO_SOURCES 0
+#endif
+#ifndef PWM1_FREQ
+#define PWM1_FREQ 4000
+#endif
+#ifndef GPIO_FREQ
+#define GPIO_FREQ 4000
+#endif
+#ifndef LOOP_COUNT
+#define LOOP_COUNT 1000000
+#endif
+
+#define GPIO_PIN 2
+
+/* intr gaps seen by the mcycle loop, for latency after the loop */
+#define GAP_BUF 128
+
+unsigned gap_end[GAP_BUF];
+unsigned gap_stamp[GAP_BUF];
+
+/* mcycle when the isr was entered */
+volatile unsigned isr_stamp;
+volatile unsigned isr_count;
+
+/* machine timer interrupts, only with GPIO_SOURCES */
+volatile unsigned timer_count;
+
+#if GPIO_SOURCES
+unsigned long long timer_period;
+
+void timer_isr(int id, void *data)
+{
+	struct metal_cpu *cpu = data;
+	volatile unsigned *gpio_output_val = (unsigned *)0x1001200cU;
+
+	metal_cpu_set_mtimecmp(cpu, metal_cpu_get_mtime(cpu) + timer_period);
+	timer_count++;
+	/* rising edge on the pin */
+	*gpio_output_val |= 1U << GPIO_PIN;
+}
+
+void gpio_isr(int id, void *data)
+{
+	__asm__ volatile("csrr %0, mcycle" : "=r"(isr_stamp));
+
+	/* pin low again and clear rise_ip */
+	volatile unsigned *gpio_output_val = (unsigned *)0x1001200cU;
+	volatile unsigned *gpio_rise_ip = (unsigned *)0x1001201cU;
+	*gpio_output_val &= ~(1U << GPIO_PIN);
+	*gpio_rise_ip = 1U << GPIO_PIN;
 
+	isr_count++;
+}
+#else
 void pwm1_isr0(int pwm_id, void *data)
 {
+	__asm__ volatile("csrr %0, mcycle" : "=r"(isr_stamp));
+
 	/* clear pwmcmp0ip */
 	volatile unsigned *addr = (unsigned *)0x10025000U;
 	unsigned val;
 	val = *addr;
 	val &= ~0x10000000;
 	*addr = val;
+
+	isr_count++;
+}
+#endif
+
+/* count mcycle for non-intr/intr code, only the end of each
+ * intr gap and the isr stamp are kept inside the loop
+ */
+int count_mcycle(int *intr, int *non_intr)
+{
+	int i, i_saved;
+	int count_intr = 0, count_non_intr = 0;
+	int while_count = LOOP_COUNT;
+	int gaps = 0;
+
+	__asm__ volatile("csrr %0, mcycle" : "=r"(i_saved));
+	while (while_count-- > 0) {
+		__asm__ volatile("csrr %0, mcycle" : "=r"(i));
+		if (i - i_saved > 50) {
+			count_intr += i - i_saved;
+			if (gaps < GAP_BUF) {
+				gap_end[gaps] = i;
+				gap_stamp[gaps] = isr_stamp;
+				gaps++;
+			}
+		} else {
+			count_non_intr += i - i_saved;
+		}
+		i_saved = i;
+	}
+	*intr = count_intr;
+	*non_intr = count_non_intr;
+	return gaps;
 }
 
 int main(void)
@@ -26,8 +130,7 @@ int main(void)
 	struct metal_cpu *cpu;
 	struct metal_interrupt *cpu_intr;
 	struct metal_interrupt *plic;
-	struct metal_pwm *pwm1;
-	int pwm1_id0, rc;
+	int src_id, rc;
 	
 	cpu = metal_cpu_get(metal_cpu_get_current_hartid());
 	if (cpu == NULL)
@@ -42,50 +145,141 @@ int main(void)
 		return 1;
 	metal_interrupt_init(plic);
 
+#if GPIO_SOURCES
+	volatile unsigned *gpio_input_en = (unsigned *)0x10012004U;
+	volatile unsigned *gpio_output_en = (unsigned *)0x10012008U;
+	volatile unsigned *gpio_output_val = (unsigned *)0x1001200cU;
+	volatile unsigned *gpio_rise_ie = (unsigned *)0x10012018U;
+	volatile unsigned *gpio_rise_ip = (unsigned *)0x1001201cU;
+
+	/* both input and output so the pin value reads back */
+	*gpio_output_val &= ~(1U << GPIO_PIN);
+	*gpio_input_en |= 1U << GPIO_PIN;
+	*gpio_output_en |= 1U << GPIO_PIN;
+	*gpio_rise_ip = 1U << GPIO_PIN;
+	*gpio_rise_ie |= 1U << GPIO_PIN;
+
+	/* gpio0 is source 8 for PLIC */
+	src_id = 8 + GPIO_PIN;
+	rc = metal_interrupt_register_handler(plic, src_id, gpio_isr, NULL);
+	if (rc)
+		return 1;
+	metal_interrupt_set_priority(plic, src_id, 2);
+
+	/* machine timer pends the pin */
+	struct metal_interrupt *tmr_intr;
+	unsigned long long timebase;
+	int tmr_id;
+	tmr_intr = metal_cpu_timer_interrupt_controller(cpu);
+	if (tmr_intr == NULL)
+		return 1;
+	metal_interrupt_init(tmr_intr);
+	tmr_id = metal_cpu_timer_get_interrupt_id(cpu);
+	rc = metal_interrupt_register_handler(tmr_intr, tmr_id, timer_isr, cpu);
+	if (rc)
+		return 1;
+	if (metal_timer_get_timebase_frequency(metal_cpu_get_current_hartid(), &timebase))
+		return 1;
+	timer_period = timebase / GPIO_FREQ;
+	metal_cpu_set_mtimecmp(cpu, metal_cpu_get_mtime(cpu) + timer_period);
+	rc = metal_interrupt_enable(tmr_intr, tmr_id);
+	if (rc)
+		return 1;
+#else
+	struct metal_pwm *pwm1;
+
 	pwm1 = metal_pwm_get_device(1);
 	if (pwm1 == NULL)
 		return 1;
-	pwm1_id0 = metal_pwm_get_interrupt_id(pwm1, 0);
-	metal_interrupt_set_priority(plic, pwm1_id0, 2);
-	rc = metal_interrupt_register_handler(plic, pwm1_id0, pwm1_isr0, pwm1);
+	src_id = metal_pwm_get_interrupt_id(pwm1, 0);
+	metal_interrupt_set_priority(plic, src_id, 2);
+	rc = metal_interrupt_register_handler(plic, src_id, pwm1_isr0, pwm1);
 	if (rc)
 		return 1;
 
 	metal_pwm_enable(pwm1);
 	/* set different intr frequency here */
-	metal_pwm_set_freq(pwm1, 0, 4000);
+	metal_pwm_set_freq(pwm1, 0, PWM1_FREQ);
 	metal_pwm_set_duty(pwm1, 1, 0, METAL_PWM_PHASE_CORRECT_DISABLE);
 	metal_pwm_set_duty(pwm1, 2, 0, METAL_PWM_PHASE_CORRECT_DISABLE);
 	metal_pwm_set_duty(pwm1, 3, 0, METAL_PWM_PHASE_CORRECT_DISABLE);
 
 	metal_pwm_trigger(pwm1, 0, METAL_PWM_CONTINUOUS);
 	metal_pwm_cfg_interrupt(pwm1, METAL_PWM_INTERRUPT_ENABLE);
+#endif
 
 	if (metal_interrupt_enable(cpu_intr, 0))
 		return 1;
-	if (metal_interrupt_enable(plic, pwm1_id0))
-		return 1;
 
-	int i = 0, i_saved;
-	int count_intr = 0, count_non_intr = 0;
-	int while_count = 1000000;
+	int i = 0, k, gaps;
+	int count_intr, count_non_intr;
+	unsigned count_start, count_end, prev_stamp;
+	unsigned wakeups = 0, latency, latency_max = 0, latency_sum = 0;
+	unsigned tick_count, cycles_per_tick = 0, tick_cycles, src_cycles;
 	/* it takes about 4 minutes to overflow mcycle to
 	 * mcycleh. mcycle only is enough to see result.
 	 */
 	__asm__ volatile("csrw mcycle, %0" :: "r"(i));
 
+#if GPIO_SOURCES
+	/* machine timer only, its share is taken out below */
+	tick_count = timer_count;
+	count_mcycle(&count_intr, &count_non_intr);
+	tick_count = timer_count - tick_count;
+	if (tick_count)
+		cycles_per_tick = (unsigned)count_intr / tick_count;
+#endif
+
+	if (metal_interrupt_enable(plic, src_id))
+		return 1;
+
 	/* count mcycle for non-intr/intr code */
-	__asm__ volatile("csrr %0, mcycle" : "=r"(i_saved));
-	while (while_count-- > 0) {
-		__asm__ volatile("csrr %0, mcycle" : "=r"(i));
-		if (i - i_saved > 50) {
-			count_intr += i - i_saved;
-		} else {
-			count_non_intr += i - i_saved;
-		}
-		i_saved = i;
+	count_start = isr_count;
+	prev_stamp = isr_stamp;
+	tick_count = timer_count;
+	gaps = count_mcycle(&count_intr, &count_non_intr);
+	tick_count = timer_count - tick_count;
+	count_end = isr_count;
+
+	/* the loop running again is the "task wakeup" of bare metal */
+	for (k = 0; k < gaps; k++) {
+		if (gap_stamp[k] == prev_stamp)
+			continue;
+		prev_stamp = gap_stamp[k];
+		latency = gap_end[k] - gap_stamp[k];
+		wakeups++;
+		latency_sum += latency;
+		if (latency > latency_max)
+			latency_max = latency;
 	}
+
+	tick_cycles = tick_count * cycles_per_tick;
+	src_cycles = (unsigned)count_intr > tick_cycles ?
+		(unsigned)count_intr - tick_cycles : 0;
+
 	printf("intr: %d\r\nnon_intr: %d\r\n", count_intr, count_non_intr);
+	printf("tick: %u cycles/tick: %u\r\n", tick_count, cycles_per_tick);
+	if (wakeups)
+		printf("cycles/intr: %u\r\nlatency avg: %u max: %u\r\n",
+			src_cycles / (count_end - count_start),
+			latency_sum / wakeups, latency_max);
+	printf("{\"demo\": \"intr-code-mcycle\", \"source\": \"%s\", "
+		"\"freq\": %d, \"intr_count\": %u, \"cycles_per_intr\": %u, "
+		"\"overhead_permille\": %u, \"tick_count\": %u, "
+		"\"cycles_per_tick\": %u, \"nesting_depth\": %d, "
+		"\"latency_avg\": %u, \"latency_max\": %u}\r\n",
+#if GPIO_SOURCES
+		"gpio", GPIO_FREQ,
+#else
+		"pwm", PWM1_FREQ,
+#endif
+		count_end - count_start,
+		count_end != count_start ?
+			src_cycles / (count_end - count_start) : 0,
+		(unsigned)((unsigned long long)src_cycles * 1000 /
+			((unsigned)count_intr + (unsigned)count_non_intr)),
+		tick_count, cycles_per_tick,
+		1, wakeups ? latency_sum / wakeups : 0, latency_max);
 
 	while (1) {
 		;
@@ -7,11 +7,40 @@
  * [change plic handler to my_alt_plic0_hander] if nested intr occurs
  * 	the new handler will print different message.
  * [set mstatus.MIE] so mstatus.MIE=mie.MEIE=mip.MEIP=1
+ *
+ * The nested intr keeps being taken. Once REENTRY_CYCLES mcycle have
+ * passed since mstatus.MIE was set, the number of re-entries, mcycle per
+ * re-entry and the most handlers seen entered at once are printed as
+ * json for bench-compare.py. Build with -DTRACE_INTR=0 to drop the
+ * printf from the re-entered handler.
+ *
+ * QEMU sifive_e leaves the pwm blocks unimplemented. Built with
+ * -DGPIO_SOURCES=1 the external intr is a rising edge main makes once
+ * on gpio pin 2 (PLIC source 10) instead, it stays pending the same way.
  */
 #include <stdio.h>
 #include <metal/machine.h>
 #include <metal/machine/platform.h>
 
+#ifndef GPIO_SOURCES
+#define GPIO_SOURCES 0
+#endif
+#ifndef REENTRY_CYCLES
+#define REENTRY_CYCLES 10000000
+#endif
+#ifndef TRACE_INTR
+#define TRACE_INTR 1
+#endif
+
+#define GPIO_PIN 2
+
+/* mcycle when my_plic0_handler sets mstatus.MIE */
+unsigned reentry_start;
+
+/* handlers entered and not returned yet */
+int nesting_depth = 0;
+int nesting_depth_max = 0;
+
 struct metal_cpu *cpu;
 struct metal_interrupt *cpu_intr;
 struct metal_interrupt *plic;
@@ -20,6 +49,10 @@ void my_alt_plic0_handler(int id, void *priv);
 void my_plic0_handler(int id, void *priv)
 {
 	int rc;
+
+	nesting_depth++;
+	if (nesting_depth > nesting_depth_max)
+		nesting_depth_max = nesting_depth;
 	printf("my_plic0_handler\r\n");
 	
 	rc = metal_interrupt_register_handler(cpu_intr, 11, my_alt_plic0_handler, plic);
@@ -27,6 +60,7 @@ void my_plic0_handler(int id, void *priv)
 		printf("rc!=0\r\n");
 
 	unsigned i = 8;
+	__asm__ volatile("csrr %0, mcycle" : "=r"(reentry_start));
 	__asm__ volatile("csrs mstatus, %0" :: "r"(i));
 	/* after execute a few instructions turns to handle nested intr.
 	 * this will not be printed out for a long time.
@@ -48,17 +82,37 @@ void my_plic0_handler(int id, void *priv)
 	val = *addr;
 	/* complete */
 	*addr = val;
+	nesting_depth--;
 }
 void my_alt_plic0_handler(int id, void *priv)
 {
-	static int i = 0;
-	printf(i++ % 60000 == 0 ? "!\r\n": "");
+	static unsigned i = 0;
+	static int reported = 0;
+	unsigned now;
+
+	nesting_depth++;
+	if (nesting_depth > nesting_depth_max)
+		nesting_depth_max = nesting_depth;
+#if TRACE_INTR
+	printf(i % 60000 == 0 ? "!\r\n": "");
+#endif
+	i++;
+
+	__asm__ volatile("csrr %0, mcycle" : "=r"(now));
+	if (!reported && now - reentry_start >= REENTRY_CYCLES) {
+		reported = 1;
+		printf("{\"demo\": \"nested-external-interrupt\", \"source\": \"%s\", "
+			"\"intr_count\": %u, \"cycles_per_intr\": %u, "
+			"\"nesting_depth\": %d}\r\n",
+			GPIO_SOURCES ? "gpio" : "pwm",
+			i, (now - reentry_start) / i, nesting_depth_max);
+	}
+	nesting_depth--;
 }
 
 int main(void)
 {
-	struct metal_pwm *pwm1;
-	int pwm1_id0, rc;
+	int src_id, rc;
 	
 	int i = 0;
 	__asm__ volatile("csrw mcycle, %0" :: "r"(i));
@@ -76,12 +130,32 @@ int main(void)
 		return 1;
 	metal_interrupt_init(plic);
 
+#if GPIO_SOURCES
+	volatile unsigned *gpio_input_en = (unsigned *)0x10012004U;
+	volatile unsigned *gpio_output_en = (unsigned *)0x10012008U;
+	volatile unsigned *gpio_output_val = (unsigned *)0x1001200cU;
+	volatile unsigned *gpio_rise_ie = (unsigned *)0x10012018U;
+	volatile unsigned *gpio_rise_ip = (unsigned *)0x1001201cU;
+
+	/* both input and output so the pin value reads back */
+	*gpio_output_val &= ~(1U << GPIO_PIN);
+	*gpio_input_en |= 1U << GPIO_PIN;
+	*gpio_output_en |= 1U << GPIO_PIN;
+	*gpio_rise_ip = 1U << GPIO_PIN;
+	*gpio_rise_ie |= 1U << GPIO_PIN;
+
+	/* gpio0 is source 8 for PLIC */
+	src_id = 8 + GPIO_PIN;
+#else
+	struct metal_pwm *pwm1;
+
 	pwm1 = metal_pwm_get_device(1);
 	if (pwm1 == NULL)
 		return 1;
-	pwm1_id0 = metal_pwm_get_interrupt_id(pwm1, 0);
+	src_id = metal_pwm_get_interrupt_id(pwm1, 0);
+#endif
 	
-	metal_interrupt_set_priority(plic, pwm1_id0, 2);
+	metal_interrupt_set_priority(plic, src_id, 2);
 
 	/* change default __metal_plic0_handler to my_plic0_handler
 	 * this one doesn't claim before set mstatus.MIE
@@ -93,6 +167,7 @@ int main(void)
 	if (rc)
 		return 1;
 
+#if !GPIO_SOURCES
 	metal_pwm_enable(pwm1);
 	metal_pwm_set_freq(pwm1, 0, 1);
 	metal_pwm_set_duty(pwm1, 1, 0, METAL_PWM_PHASE_CORRECT_DISABLE);
@@ -101,11 +176,16 @@ int main(void)
 
 	metal_pwm_trigger(pwm1, 0, METAL_PWM_CONTINUOUS);
 	metal_pwm_cfg_interrupt(pwm1, METAL_PWM_INTERRUPT_ENABLE);
+#endif
 
 	if (metal_interrupt_enable(cpu_intr, 0))
 		return 1;
-	if (metal_interrupt_enable(plic, pwm1_id0))
+	if (metal_interrupt_enable(plic, src_id))
 		return 1;
+#if GPIO_SOURCES
+	/* rising edge on the pin */
+	*gpio_output_val |= 1U << GPIO_PIN;
+#endif
 	
 	while (1) ;
 	return 2;
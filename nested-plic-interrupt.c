@@ -3,19 +3,102 @@
  *
  * pwm1.pwmcmp0ip asserts interrupt level to corresponding PLIC gateway 5 times/second.
  * pwm2.pwmcmp0ip asserts interrupt level to corresponding PLIC gateway 53 times/second.
+ * (defaults of PWM1_FREQ, PWM2_FREQ)
  * The later is the higher priority source to PLIC.
  *
+ * Built with -DGPIO_SOURCES=1 the two sources are gpio pins 2 and 3
+ * (PLIC source 10 and 11) with the same priorities, so it also runs
+ * on QEMU sifive_e. The machine timer makes a rising edge on pin 2
+ * GPIO_FREQ times/second and the isr of pin 2 makes one on pin 3.
+ *
  * Instead of using the default external interrupt handler in the 
  * __metal_driver_riscv_cpu_intc structure's metal_int_table 
  * which is assigned during the __metal_driver_riscv_plic0 structure 
  * initialization, use new_plic_handler which supports nested interrupt
  * which is also notificated to the hart by PLIC.
+ *
+ * main then counts mcycle for intr/non-intr code like intr-code-mcycle.c.
+ * The outermost new_plic_handler returning is the "task wakeup" of bare
+ * metal, it records mcycle from each isr run since the last one to
+ * there, over the whole run. This is the bare metal side of
+ * freertos-nested-plic-interrupt.c, both run the same loop, build both
+ * with the same PWM1_FREQ/PWM2_FREQ or GPIO_SOURCES to compare (make
+ * bench does). At such rates TRACE_NESTING=0 is needed to drop the printf
+ * in the handler. With GPIO_SOURCES the loop first runs with only the
+ * timer enabled, and cycles/tick is taken out of the intr cycles the
+ * same way as the tick in the FreeRTOS demo. The last line printed is
+ * the result as json for bench-compare.py.
  */
 #include <stdio.h>
 #include <metal/machine.h>
 #include <metal/machine/platform.h>
+#include <metal/timer.h>
+
+#ifndef GPIO_SOURCES
+#define GPIO_SOURCES 0
+#endif
+#ifndef PWM1_FREQ
+#define PWM1_FREQ 5
+#endif
+#ifndef PWM2_FREQ
+#define PWM2_FREQ 53
+#endif
+#ifndef GPIO_FREQ
+#define GPIO_FREQ 1000
+#endif
+#ifndef TRACE_NESTING
+#define TRACE_NESTING 1
+#endif
+#ifndef LOOP_COUNT
+#define LOOP_COUNT 1000000
+#endif
+
+#define GPIO_PIN1 2
+#define GPIO_PIN2 3
+
+struct intr_source {
+	struct metal_pwm *pwm;
+	int gpio_pin;
+	int plic_id;
+	/* mcycle when the isr was entered */
+	volatile unsigned stamp;
+	volatile unsigned intr_count;
+	/* intr_count at the last wakeup */
+	unsigned delivered;
+	unsigned wakeups;
+	unsigned latency_max;
+	unsigned long long latency_sum;
+};
+
+struct intr_source intr_sources[2];
+
+/* machine timer interrupts, only with GPIO_SOURCES */
+volatile unsigned timer_count;
 
 int nesting_depth = 0;
+int nesting_depth_max = 0;
+
+/* called with interrupt disabled when the outermost handler is done */
+void wake_sources(void)
+{
+	struct intr_source *src;
+	unsigned now, latency;
+	int n;
+
+	__asm__ volatile("csrr %0, mcycle" : "=r"(now));
+	for (n = 0; n < 2; n++) {
+		src = &intr_sources[n];
+		if (src->intr_count == src->delivered)
+			continue;
+		/* like merged notifications, measure from the latest isr */
+		src->delivered = src->intr_count;
+		latency = now - src->stamp;
+		src->wakeups++;
+		src->latency_sum += latency;
+		if (latency > src->latency_max)
+			src->latency_max = latency;
+	}
+}
 
 void new_plic_handler(int id, void *priv)
 {
@@ -24,6 +107,8 @@ void new_plic_handler(int id, void *priv)
 	 * the incrementation happen
 	 */
 	nesting_depth++;
+	if (nesting_depth > nesting_depth_max)
+		nesting_depth_max = nesting_depth;
 
 	/* is it good to use these structures out of
 	 * metal library, it is intended to be internal?
@@ -33,8 +118,10 @@ void new_plic_handler(int id, void *priv)
 	/* interrupt claim process to PLIC */
 	volatile unsigned *plic_claim_addr = (unsigned *)0xc200004U;
 	unsigned plic_source = *plic_claim_addr;
+#if TRACE_NESTING
 	/* to show the source # and nesting depth */
 	printf("%d %d\r\n", plic_source, nesting_depth);
+#endif
 	
 	/* get the PLIC priority assigned to this source */
 	unsigned plic_source_priority =
@@ -80,13 +167,81 @@ void new_plic_handler(int id, void *priv)
 	/* interrupt complete process to PLIC */
 	*plic_claim_addr = plic_source;
 
+	if (nesting_depth == 1)
+		wake_sources();
 	nesting_depth--;
 }
 
+#if GPIO_SOURCES
+unsigned long long timer_period;
+
+void timer_isr(int id, void *data)
+{
+	struct metal_cpu *cpu = data;
+	volatile unsigned *gpio_output_val = (unsigned *)0x1001200cU;
+
+	metal_cpu_set_mtimecmp(cpu, metal_cpu_get_mtime(cpu) + timer_period);
+	timer_count++;
+	/* rising edge on pin 2 */
+	*gpio_output_val |= 1U << GPIO_PIN1;
+}
+
+void gpiox_isr(int id, void *data)
+{
+	struct intr_source *src = data;
+	volatile unsigned *gpio_output_val = (unsigned *)0x1001200cU;
+	volatile unsigned *gpio_rise_ip = (unsigned *)0x1001201cU;
+	unsigned mstatus, mstatus_MIE = 8;
+
+	__asm__ volatile("csrr %0, mcycle" : "=r"(src->stamp));
+
+	/* pin low again and clear rise_ip, pin 2 also pends pin 3.
+	 * output_val is read-modify-write, keep timer_isr and
+	 * pin 3's isr out
+	 */
+	__asm__ volatile("csrrc %0, mstatus, %1" : "=r"(mstatus) : "r"(mstatus_MIE));
+	*gpio_output_val &= ~(1U << src->gpio_pin);
+	*gpio_rise_ip = 1U << src->gpio_pin;
+	if (src->gpio_pin == GPIO_PIN1)
+		*gpio_output_val |= 1U << GPIO_PIN2;
+	__asm__ volatile("csrs mstatus, %0" :: "r"(mstatus & mstatus_MIE));
+
+	src->intr_count++;
+}
+#else
 void pwmx_isr0(int pwm_id, void *data)
 {
+	struct intr_source *src = data;
+
+	__asm__ volatile("csrr %0, mcycle" : "=r"(src->stamp));
+
 	/* clear pwmx.pwmcmp0ip */
-	metal_pwm_clr_interrupt((struct metal_pwm *)data, 0);
+	metal_pwm_clr_interrupt(src->pwm, 0);
+	src->intr_count++;
+}
+#endif
+
+/* count mcycle for non-intr/intr code, same loop as
+ * freertos-nested-plic-interrupt.c
+ */
+void count_mcycle(int *intr, int *non_intr)
+{
+	int i, i_saved;
+	int count_intr = 0, count_non_intr = 0;
+	int while_count = LOOP_COUNT;
+
+	__asm__ volatile("csrr %0, mcycle" : "=r"(i_saved));
+	while (while_count-- > 0) {
+		__asm__ volatile("csrr %0, mcycle" : "=r"(i));
+		if (i - i_saved > 50) {
+			count_intr += i - i_saved;
+		} else {
+			count_non_intr += i - i_saved;
+		}
+		i_saved = i;
+	}
+	*intr = count_intr;
+	*non_intr = count_non_intr;
 }
 
 int main(void)
@@ -94,8 +249,6 @@ int main(void)
 	struct metal_cpu *cpu;
 	struct metal_interrupt *cpu_intr;
 	struct metal_interrupt *plic;
-	struct metal_pwm *pwm1, *pwm2;
-	int pwm1_id0, pwm2_id0;
 	int rc;
 	
 	cpu = metal_cpu_get(metal_cpu_get_current_hartid());
@@ -115,32 +268,89 @@ int main(void)
 	if (rc)
 		return 1;
 
+#if GPIO_SOURCES
+	volatile unsigned *gpio_input_en = (unsigned *)0x10012004U;
+	volatile unsigned *gpio_output_en = (unsigned *)0x10012008U;
+	volatile unsigned *gpio_output_val = (unsigned *)0x1001200cU;
+	volatile unsigned *gpio_rise_ie = (unsigned *)0x10012018U;
+	volatile unsigned *gpio_rise_ip = (unsigned *)0x1001201cU;
+	unsigned pins = (1U << GPIO_PIN1) | (1U << GPIO_PIN2);
+
+	/* both input and output so the pin value reads back */
+	*gpio_output_val &= ~pins;
+	*gpio_input_en |= pins;
+	*gpio_output_en |= pins;
+	*gpio_rise_ip = pins;
+	*gpio_rise_ie |= pins;
+
+	/* gpio0 is source 8 for PLIC */
+	intr_sources[0].gpio_pin = GPIO_PIN1;
+	intr_sources[0].plic_id = 8 + GPIO_PIN1;
+	rc = metal_interrupt_register_handler(plic, intr_sources[0].plic_id,
+			gpiox_isr, &intr_sources[0]);
+	if (rc)
+		return 1;
+	intr_sources[1].gpio_pin = GPIO_PIN2;
+	intr_sources[1].plic_id = 8 + GPIO_PIN2;
+	rc = metal_interrupt_register_handler(plic, intr_sources[1].plic_id,
+			gpiox_isr, &intr_sources[1]);
+	if (rc)
+		return 1;
+	metal_interrupt_set_priority(plic, intr_sources[0].plic_id, 2);
+	metal_interrupt_set_priority(plic, intr_sources[1].plic_id, 5);
+
+	/* machine timer pends pin 2 */
+	struct metal_interrupt *tmr_intr;
+	unsigned long long timebase;
+	int tmr_id;
+	tmr_intr = metal_cpu_timer_interrupt_controller(cpu);
+	if (tmr_intr == NULL)
+		return 1;
+	metal_interrupt_init(tmr_intr);
+	tmr_id = metal_cpu_timer_get_interrupt_id(cpu);
+	rc = metal_interrupt_register_handler(tmr_intr, tmr_id, timer_isr, cpu);
+	if (rc)
+		return 1;
+	if (metal_timer_get_timebase_frequency(metal_cpu_get_current_hartid(), &timebase))
+		return 1;
+	timer_period = timebase / GPIO_FREQ;
+	metal_cpu_set_mtimecmp(cpu, metal_cpu_get_mtime(cpu) + timer_period);
+	rc = metal_interrupt_enable(tmr_intr, tmr_id);
+	if (rc)
+		return 1;
+#else
+	struct metal_pwm *pwm1, *pwm2;
+
 	pwm1 = metal_pwm_get_device(1);
 	if (pwm1 == NULL)
 		return 1;
-	pwm1_id0 = metal_pwm_get_interrupt_id(pwm1, 0);		/* source 44 for PLIC */
-	rc = metal_interrupt_register_handler(plic, pwm1_id0, pwmx_isr0, pwm1);
+	intr_sources[0].pwm = pwm1;
+	intr_sources[0].plic_id = metal_pwm_get_interrupt_id(pwm1, 0);	/* source 44 for PLIC */
+	rc = metal_interrupt_register_handler(plic, intr_sources[0].plic_id,
+			pwmx_isr0, &intr_sources[0]);
 	if (rc)
 		return 1;
-	metal_interrupt_set_priority(plic, pwm1_id0, 2);
+	metal_interrupt_set_priority(plic, intr_sources[0].plic_id, 2);
 
 	pwm2 = metal_pwm_get_device(2);
 	if (pwm2 == NULL)
 		return 1;
-	pwm2_id0 = metal_pwm_get_interrupt_id(pwm2, 0);		/* source 48 for PLIC */
-	rc = metal_interrupt_register_handler(plic, pwm2_id0, pwmx_isr0, pwm2);
+	intr_sources[1].pwm = pwm2;
+	intr_sources[1].plic_id = metal_pwm_get_interrupt_id(pwm2, 0);	/* source 48 for PLIC */
+	rc = metal_interrupt_register_handler(plic, intr_sources[1].plic_id,
+			pwmx_isr0, &intr_sources[1]);
 	if (rc)
 		return 1;
-	metal_interrupt_set_priority(plic, pwm2_id0, 5);
+	metal_interrupt_set_priority(plic, intr_sources[1].plic_id, 5);
 
 	metal_pwm_enable(pwm1);
-	metal_pwm_set_freq(pwm1, 0, 5);
+	metal_pwm_set_freq(pwm1, 0, PWM1_FREQ);
 	metal_pwm_set_duty(pwm1, 1, 0, METAL_PWM_PHASE_CORRECT_DISABLE);
 	metal_pwm_set_duty(pwm1, 2, 0, METAL_PWM_PHASE_CORRECT_DISABLE);
 	metal_pwm_set_duty(pwm1, 3, 0, METAL_PWM_PHASE_CORRECT_DISABLE);
 
 	metal_pwm_enable(pwm2);
-	metal_pwm_set_freq(pwm2, 0, 53);
+	metal_pwm_set_freq(pwm2, 0, PWM2_FREQ);
 	metal_pwm_set_duty(pwm2, 1, 0, METAL_PWM_PHASE_CORRECT_DISABLE);
 	metal_pwm_set_duty(pwm2, 2, 0, METAL_PWM_PHASE_CORRECT_DISABLE);
 	metal_pwm_set_duty(pwm2, 3, 0, METAL_PWM_PHASE_CORRECT_DISABLE);
@@ -150,17 +360,89 @@ int main(void)
 	
 	metal_pwm_trigger(pwm2, 0, METAL_PWM_CONTINUOUS);
 	metal_pwm_cfg_interrupt(pwm2, METAL_PWM_INTERRUPT_ENABLE);
+#endif
 
-	rc = metal_interrupt_enable(plic, pwm1_id0);
+	rc = metal_interrupt_enable(cpu_intr, 0);
 	if (rc)
 		return 1;
-	rc = metal_interrupt_enable(plic, pwm2_id0);
+
+	int n;
+	int count_intr, count_non_intr;
+	unsigned intr_count[2];
+	unsigned latency_avg[2] = {0, 0};
+	unsigned tick_count, cycles_per_tick = 0, tick_cycles, src_cycles;
+
+#if GPIO_SOURCES
+	/* machine timer only, its share is taken out below like
+	 * the tick in freertos-nested-plic-interrupt.c
+	 */
+	tick_count = timer_count;
+	count_mcycle(&count_intr, &count_non_intr);
+	tick_count = timer_count - tick_count;
+	if (tick_count)
+		cycles_per_tick = (unsigned)count_intr / tick_count;
+#endif
+
+	rc = metal_interrupt_enable(plic, intr_sources[0].plic_id);
 	if (rc)
 		return 1;
-	rc = metal_interrupt_enable(cpu_intr, 0);
+	rc = metal_interrupt_enable(plic, intr_sources[1].plic_id);
 	if (rc)
 		return 1;
 
+	for (n = 0; n < 2; n++)
+		intr_count[n] = intr_sources[n].intr_count;
+	tick_count = timer_count;
+	count_mcycle(&count_intr, &count_non_intr);
+	tick_count = timer_count - tick_count;
+
+	/* stop the sources before looking at what the handler recorded */
+	metal_interrupt_disable(plic, intr_sources[0].plic_id);
+	metal_interrupt_disable(plic, intr_sources[1].plic_id);
+	for (n = 0; n < 2; n++)
+		intr_count[n] = intr_sources[n].intr_count - intr_count[n];
+
+	tick_cycles = tick_count * cycles_per_tick;
+	src_cycles = (unsigned)count_intr > tick_cycles ?
+		(unsigned)count_intr - tick_cycles : 0;
+
+	printf("intr: %d\r\nnon_intr: %d\r\n", count_intr, count_non_intr);
+	printf("tick: %u cycles/tick: %u\r\n", tick_count, cycles_per_tick);
+	if (intr_count[0] + intr_count[1])
+		printf("cycles/intr: %u\r\n",
+			src_cycles / (intr_count[0] + intr_count[1]));
+	printf("max nesting depth: %d\r\n", nesting_depth_max);
+	for (n = 0; n < 2; n++) {
+		if (intr_sources[n].wakeups == 0)
+			continue;
+		latency_avg[n] = (unsigned)(intr_sources[n].latency_sum /
+			intr_sources[n].wakeups);
+		printf("source%d intr: %u wakeups: %u latency avg: %u max: %u\r\n",
+			n + 1, intr_count[n], intr_sources[n].wakeups,
+			latency_avg[n], intr_sources[n].latency_max);
+	}
+	printf("{\"demo\": \"nested-plic-interrupt\", "
+		"\"source\": \"%s\", \"freq\": [%d, %d], \"intr_count\": %u, "
+		"\"cycles_per_intr\": %u, \"overhead_permille\": %u, "
+		"\"tick_count\": %u, \"cycles_per_tick\": %u, "
+		"\"nesting_depth\": %d, \"wakeups\": [%u, %u], "
+		"\"latency_avg\": [%u, %u], \"latency_max\": [%u, %u]}\r\n",
+#if GPIO_SOURCES
+		"gpio", GPIO_FREQ, GPIO_FREQ,
+#else
+		"pwm", PWM1_FREQ, PWM2_FREQ,
+#endif
+		intr_count[0] + intr_count[1],
+		intr_count[0] + intr_count[1] ?
+			src_cycles / (intr_count[0] + intr_count[1]) : 0,
+		(unsigned)((unsigned long long)src_cycles * 1000 /
+			((unsigned)count_intr + (unsigned)count_non_intr)),
+		tick_count, cycles_per_tick,
+		nesting_depth_max,
+		intr_sources[0].wakeups, intr_sources[1].wakeups,
+		latency_avg[0], latency_avg[1],
+		intr_sources[0].latency_max, intr_sources[1].latency_max);
+
 	while (1) ;
 	return 2;
 }
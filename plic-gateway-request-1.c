@@ -13,25 +13,90 @@
  * priority exceeds PLIC threshold.
  * Purpose is to show whether generating an interrupt request
  * stops PLIC gateways from generating more.
+ *
+ * After enabling, main counts mcycle for intr/non-intr code like
+ * intr-code-mcycle.c and prints the result as json for bench-compare.py,
+ * below_threshold_count is how many times pwm1_isr1 was called.
+ * Build with -DPWM1_FREQ=n for another rate than 1/second, and with
+ * -DTRACE_INTR=0 to drop the printf in the isrs from the timed loop.
+ *
+ * QEMU sifive_e leaves the pwm blocks unimplemented. Built with
+ * -DGPIO_SOURCES=1 the source above threshold is a rising edge on gpio
+ * pin 2 (PLIC source 10) made by the machine timer GPIO_FREQ
+ * times/second, the one below is gpio pin 3 (source 11) held high with
+ * high_ie, which like pwmcmp1ip stays asserted. The loop then first
+ * runs with only the timer enabled and cycles/tick is taken out of the
+ * intr cycles like in nested-plic-interrupt.c.
  */
 #include <stdio.h>
 #include <metal/machine.h>
 #include <metal/machine/platform.h>
+#include <metal/timer.h>
+
+#ifndef GPIO_SOURCES
+#define GPIO_SOURCES 0
+#endif
+#ifndef PWM1_FREQ
+#define PWM1_FREQ 1
+#endif
+#ifndef GPIO_FREQ
+#define GPIO_FREQ 1
+#endif
+#ifndef LOOP_COUNT
+#define LOOP_COUNT 1000000
+#endif
+#ifndef TRACE_INTR
+#define TRACE_INTR 1
+#endif
+
+#define GPIO_PIN0 2
+#define GPIO_PIN1 3
+
+volatile unsigned isr0_count, isr1_count;
+
+/* machine timer interrupts, only with GPIO_SOURCES */
+volatile unsigned timer_count;
+
+#if GPIO_SOURCES
+unsigned long long timer_period;
+
+void timer_isr(int id, void *data)
+{
+	struct metal_cpu *cpu = data;
+	volatile unsigned *gpio_output_val = (unsigned *)0x1001200cU;
+
+	metal_cpu_set_mtimecmp(cpu, metal_cpu_get_mtime(cpu) + timer_period);
+	timer_count++;
+	/* rising edge on pin 2 */
+	*gpio_output_val |= 1U << GPIO_PIN0;
+}
+#endif
 
 void pwm1_isr0(int pwm_id, void *data)
 {
+#if GPIO_SOURCES
+	/* pin 2 low again and clear its rise_ip */
+	volatile unsigned *gpio_output_val = (unsigned *)0x1001200cU;
+	volatile unsigned *gpio_rise_ip = (unsigned *)0x1001201cU;
+	*gpio_output_val &= ~(1U << GPIO_PIN0);
+	*gpio_rise_ip = 1U << GPIO_PIN0;
+#else
 	/* clear pwmcmp0ip */
 	volatile unsigned *addr = (unsigned *)0x10025000U;
 	unsigned val;
 	val = *addr;
 	val &= ~0x10000000;
 	*addr = val;
+#endif
 
 	/* if PLIC gateways stop to forward request once any
 	 * request is forwarded and start again when the interrupt
 	 * completion process finishes, this should never be reached
 	 */	
+#if TRACE_INTR
 	printf("reach here?\r\n");
+#endif
+	isr0_count++;
 }
 
 void pwm1_isr1(int pwm_id, void *data)
@@ -42,8 +107,32 @@ void pwm1_isr1(int pwm_id, void *data)
 	 * 
 	 * this isr shouldn't be called
 	 */
+#if TRACE_INTR
 	static int i = 0;
 	printf(i++ %30000 == 0 ? "!\r\n" : "");
+#endif
+	isr1_count++;
+}
+
+/* same loop as intr-code-mcycle.c */
+void count_mcycle(int *intr, int *non_intr)
+{
+	int i, i_saved;
+	int count_intr = 0, count_non_intr = 0;
+	int while_count = LOOP_COUNT;
+
+	__asm__ volatile("csrr %0, mcycle" : "=r"(i_saved));
+	while (while_count-- > 0) {
+		__asm__ volatile("csrr %0, mcycle" : "=r"(i));
+		if (i - i_saved > 50) {
+			count_intr += i - i_saved;
+		} else {
+			count_non_intr += i - i_saved;
+		}
+		i_saved = i;
+	}
+	*intr = count_intr;
+	*non_intr = count_non_intr;
 }
 
 int main(void)
@@ -51,7 +140,6 @@ int main(void)
 	struct metal_cpu *cpu;
 	struct metal_interrupt *cpu_intr;
 	struct metal_interrupt *plic;
-	struct metal_pwm *pwm1;
 	int pwm1_id0, pwm1_id1, rc;
 	
 	cpu = metal_cpu_get(metal_cpu_get_current_hartid());
@@ -70,15 +158,44 @@ int main(void)
 	/* change threshold to 1 */
 	metal_interrupt_set_threshold(plic, 1);
 
+#if GPIO_SOURCES
+	volatile unsigned *gpio_input_en = (unsigned *)0x10012004U;
+	volatile unsigned *gpio_output_en = (unsigned *)0x10012008U;
+	volatile unsigned *gpio_output_val = (unsigned *)0x1001200cU;
+	volatile unsigned *gpio_rise_ie = (unsigned *)0x10012018U;
+	volatile unsigned *gpio_rise_ip = (unsigned *)0x1001201cU;
+	volatile unsigned *gpio_high_ie = (unsigned *)0x10012028U;
+	volatile unsigned *gpio_high_ip = (unsigned *)0x1001202cU;
+	unsigned pins = (1U << GPIO_PIN0) | (1U << GPIO_PIN1);
+
+	/* both input and output so the pin value reads back,
+	 * pin 3 is high from now on
+	 */
+	*gpio_output_val &= ~(1U << GPIO_PIN0);
+	*gpio_output_val |= 1U << GPIO_PIN1;
+	*gpio_input_en |= pins;
+	*gpio_output_en |= pins;
+	*gpio_rise_ip = 1U << GPIO_PIN0;
+	*gpio_rise_ie |= 1U << GPIO_PIN0;
+	*gpio_high_ip = 1U << GPIO_PIN1;
+	*gpio_high_ie |= 1U << GPIO_PIN1;
+
+	/* gpio0 is source 8 for PLIC, the isrs keep their pwm names */
+	pwm1_id0 = 8 + GPIO_PIN0;
+	pwm1_id1 = 8 + GPIO_PIN1;
+#else
+	struct metal_pwm *pwm1;
+
 	pwm1 = metal_pwm_get_device(1);
 	if (pwm1 == NULL)
 		return 1;
 	pwm1_id0 = metal_pwm_get_interrupt_id(pwm1, 0);
 	pwm1_id1 = metal_pwm_get_interrupt_id(pwm1, 1);
-	rc = metal_interrupt_register_handler(plic, pwm1_id0, pwm1_isr0, pwm1);
+#endif
+	rc = metal_interrupt_register_handler(plic, pwm1_id0, pwm1_isr0, NULL);
 	if (rc)
 		return 1;
-	rc = metal_interrupt_register_handler(plic, pwm1_id1, pwm1_isr1, pwm1);
+	rc = metal_interrupt_register_handler(plic, pwm1_id1, pwm1_isr1, NULL);
 	if (rc)
 		return 1;
 	/* source pwmcmp0ip's threshold exceeds threshold,
@@ -89,8 +206,29 @@ int main(void)
 	metal_interrupt_set_priority(plic, pwm1_id0, 3);
 	metal_interrupt_set_priority(plic, pwm1_id1, 0);
 
+#if GPIO_SOURCES
+	/* machine timer pends pin 2 */
+	struct metal_interrupt *tmr_intr;
+	unsigned long long timebase;
+	int tmr_id;
+	tmr_intr = metal_cpu_timer_interrupt_controller(cpu);
+	if (tmr_intr == NULL)
+		return 1;
+	metal_interrupt_init(tmr_intr);
+	tmr_id = metal_cpu_timer_get_interrupt_id(cpu);
+	rc = metal_interrupt_register_handler(tmr_intr, tmr_id, timer_isr, cpu);
+	if (rc)
+		return 1;
+	if (metal_timer_get_timebase_frequency(metal_cpu_get_current_hartid(), &timebase))
+		return 1;
+	timer_period = timebase / GPIO_FREQ;
+	metal_cpu_set_mtimecmp(cpu, metal_cpu_get_mtime(cpu) + timer_period);
+	rc = metal_interrupt_enable(tmr_intr, tmr_id);
+	if (rc)
+		return 1;
+#else
 	metal_pwm_enable(pwm1);
-	metal_pwm_set_freq(pwm1, 0, 1);
+	metal_pwm_set_freq(pwm1, 0, PWM1_FREQ);
 	/* set pwmcmp1gpio's duty to 50 so pwmcmp1ip will be pending
 	 * earlier than pwmcmp0ip
 	 */
@@ -100,13 +238,58 @@ int main(void)
 
 	metal_pwm_trigger(pwm1, 0, METAL_PWM_CONTINUOUS);
 	metal_pwm_cfg_interrupt(pwm1, METAL_PWM_INTERRUPT_ENABLE);
+#endif
 
 	if (metal_interrupt_enable(cpu_intr, 0))
 		return 1;
+
+	int count_intr, count_non_intr;
+	unsigned count0_start, count1_start;
+	unsigned intr_count, below_count;
+	unsigned tick_count, cycles_per_tick = 0, tick_cycles, src_cycles;
+
+#if GPIO_SOURCES
+	/* machine timer only, its share is taken out below */
+	tick_count = timer_count;
+	count_mcycle(&count_intr, &count_non_intr);
+	tick_count = timer_count - tick_count;
+	if (tick_count)
+		cycles_per_tick = (unsigned)count_intr / tick_count;
+#endif
+
 	if (metal_interrupt_enable(plic, pwm1_id0))
 		return 1;
 	if (metal_interrupt_enable(plic, pwm1_id1))
 		return 1;
+
+	count0_start = isr0_count;
+	count1_start = isr1_count;
+	tick_count = timer_count;
+	count_mcycle(&count_intr, &count_non_intr);
+	tick_count = timer_count - tick_count;
+	intr_count = isr0_count - count0_start;
+	below_count = isr1_count - count1_start;
+
+	tick_cycles = tick_count * cycles_per_tick;
+	src_cycles = (unsigned)count_intr > tick_cycles ?
+		(unsigned)count_intr - tick_cycles : 0;
+	printf("{\"demo\": \"plic-gateway-request-1\", \"source\": \"%s\", "
+		"\"freq\": %d, \"intr_count\": %u, "
+		"\"below_threshold_count\": %u, \"cycles_per_intr\": %u, "
+		"\"overhead_permille\": %u, \"tick_count\": %u, "
+		"\"cycles_per_tick\": %u, \"nesting_depth\": %d}\r\n",
+#if GPIO_SOURCES
+		"gpio", GPIO_FREQ,
+#else
+		"pwm", PWM1_FREQ,
+#endif
+		intr_count, below_count,
+		intr_count + below_count ?
+			src_cycles / (intr_count + below_count) : 0,
+		(unsigned)((unsigned long long)src_cycles * 1000 /
+			((unsigned)count_intr + (unsigned)count_non_intr)),
+		tick_count, cycles_per_tick,
+		intr_count + below_count ? 1 : 0);
 	
 	while (1) ;
 	return 2;
@@ -6,13 +6,77 @@
  * [claim] corresponding IP bit in PLIC is cleared, intr id returned.
  * [clear pwmcmp0ip] pending flag at the intr source need to be cleared.
  * [complete] so PLIC gateway can send intr request again.
+ *
+ * After enabling, main counts mcycle for intr/non-intr code like
+ * intr-code-mcycle.c and prints the result as json for bench-compare.py.
+ * Build with -DPWM1_FREQ=n for another rate than 1/second, and with
+ * -DTRACE_INTR=0 to drop the printf in the isr from the timed loop.
+ *
+ * QEMU sifive_e leaves the pwm blocks unimplemented. Built with
+ * -DGPIO_SOURCES=1 the source is gpio pin 2 (PLIC source 10) instead,
+ * the machine timer makes a rising edge on it GPIO_FREQ times/second.
+ * The loop then first runs with only the timer enabled and cycles/tick
+ * is taken out of the intr cycles like in nested-plic-interrupt.c.
  */
 #include <stdio.h>
 #include <metal/machine.h>
 #include <metal/machine/platform.h>
+#include <metal/timer.h>
+
+#ifndef GPIO_SOURCES
+#define GPIO_SOURCES 0
+#endif
+#ifndef PWM1_FREQ
+#define PWM1_FREQ 1
+#endif
+#ifndef GPIO_FREQ
+#define GPIO_FREQ 1
+#endif
+#ifndef LOOP_COUNT
+#define LOOP_COUNT 1000000
+#endif
+#ifndef TRACE_INTR
+#define TRACE_INTR 1
+#endif
+
+#define GPIO_PIN 2
 
 struct metal_cpu *cpu;
+volatile unsigned isr_count;
+
+/* machine timer interrupts, only with GPIO_SOURCES */
+volatile unsigned timer_count;
+
+#if GPIO_SOURCES
+unsigned long long timer_period;
+
+void timer_isr(int id, void *data)
+{
+	volatile unsigned *gpio_output_val = (unsigned *)0x1001200cU;
+
+	metal_cpu_set_mtimecmp(cpu, metal_cpu_get_mtime(cpu) + timer_period);
+	timer_count++;
+	/* rising edge on the pin */
+	*gpio_output_val |= 1U << GPIO_PIN;
+}
 
+/* param will be given: id in PLIC, 10, NULL */
+void gpio_isr(int id, void *data)
+{
+	/* pin low again and clear rise_ip */
+	volatile unsigned *gpio_output_val = (unsigned *)0x1001200cU;
+	volatile unsigned *gpio_rise_ip = (unsigned *)0x1001201cU;
+	*gpio_output_val &= ~(1U << GPIO_PIN);
+	*gpio_rise_ip = 1U << GPIO_PIN;
+
+#if TRACE_INTR
+	int i;
+	__asm__ volatile("csrr %0, mcycle" : "=r"(i));
+	printf("mcycle=0x%x\r\n", i);
+#endif
+	isr_count++;
+}
+#else
 /* param will be given: id in PLIC, 44, the pwm structure */
 void pwm1_isr0(int pwm_id, void *data)
 {
@@ -23,17 +87,41 @@ void pwm1_isr0(int pwm_id, void *data)
 	val &= ~0x10000000;
 	*addr = val;
 	
+#if TRACE_INTR
 	int i;
 	__asm__ volatile("csrr %0, mcycle" : "=r"(i));
 	printf("mcycle=0x%x\r\n", i);
+#endif
+	isr_count++;
+}
+#endif
+
+/* same loop as intr-code-mcycle.c */
+void count_mcycle(int *intr, int *non_intr)
+{
+	int i, i_saved;
+	int count_intr = 0, count_non_intr = 0;
+	int while_count = LOOP_COUNT;
+
+	__asm__ volatile("csrr %0, mcycle" : "=r"(i_saved));
+	while (while_count-- > 0) {
+		__asm__ volatile("csrr %0, mcycle" : "=r"(i));
+		if (i - i_saved > 50) {
+			count_intr += i - i_saved;
+		} else {
+			count_non_intr += i - i_saved;
+		}
+		i_saved = i;
+	}
+	*intr = count_intr;
+	*non_intr = count_non_intr;
 }
 
 int main(void)
 {
 	struct metal_interrupt *cpu_intr;
 	struct metal_interrupt *plic;
-	struct metal_pwm *pwm1;
-	int pwm1_id0, rc;
+	int src_id, rc;
 	
 	int i = 0;
 	__asm__ volatile("csrw mcycle, %0" :: "r"(i));
@@ -60,22 +148,65 @@ int main(void)
 	 */
 	metal_interrupt_init(plic);
 
+#if GPIO_SOURCES
+	volatile unsigned *gpio_input_en = (unsigned *)0x10012004U;
+	volatile unsigned *gpio_output_en = (unsigned *)0x10012008U;
+	volatile unsigned *gpio_output_val = (unsigned *)0x1001200cU;
+	volatile unsigned *gpio_rise_ie = (unsigned *)0x10012018U;
+	volatile unsigned *gpio_rise_ip = (unsigned *)0x1001201cU;
+
+	/* both input and output so the pin value reads back */
+	*gpio_output_val &= ~(1U << GPIO_PIN);
+	*gpio_input_en |= 1U << GPIO_PIN;
+	*gpio_output_en |= 1U << GPIO_PIN;
+	*gpio_rise_ip = 1U << GPIO_PIN;
+	*gpio_rise_ie |= 1U << GPIO_PIN;
+
+	/* gpio0 is source 8 for PLIC */
+	src_id = 8 + GPIO_PIN;
+	rc = metal_interrupt_register_handler(plic, src_id, gpio_isr, NULL);
+	if (rc)
+		return 1;
+	metal_interrupt_set_priority(plic, src_id, 2);
+
+	/* machine timer pends the pin */
+	struct metal_interrupt *tmr_intr;
+	unsigned long long timebase;
+	int tmr_id;
+	tmr_intr = metal_cpu_timer_interrupt_controller(cpu);
+	if (tmr_intr == NULL)
+		return 1;
+	metal_interrupt_init(tmr_intr);
+	tmr_id = metal_cpu_timer_get_interrupt_id(cpu);
+	rc = metal_interrupt_register_handler(tmr_intr, tmr_id, timer_isr, cpu);
+	if (rc)
+		return 1;
+	if (metal_timer_get_timebase_frequency(metal_cpu_get_current_hartid(), &timebase))
+		return 1;
+	timer_period = timebase / GPIO_FREQ;
+	metal_cpu_set_mtimecmp(cpu, metal_cpu_get_mtime(cpu) + timer_period);
+	rc = metal_interrupt_enable(tmr_intr, tmr_id);
+	if (rc)
+		return 1;
+#else
+	struct metal_pwm *pwm1;
+
 	/* pwm and its source for PLIC */
 	pwm1 = metal_pwm_get_device(1);
 	if (pwm1 == NULL)
 		return 1;
 	/* will get 44 in PLIC lines */
-	pwm1_id0 = metal_pwm_get_interrupt_id(pwm1, 0);
-	metal_interrupt_set_priority(plic, pwm1_id0, 2);
+	src_id = metal_pwm_get_interrupt_id(pwm1, 0);
+	metal_interrupt_set_priority(plic, src_id, 2);
 	/* save isr in PLIC table entry */
-	rc = metal_interrupt_register_handler(plic, pwm1_id0, pwm1_isr0, pwm1);
+	rc = metal_interrupt_register_handler(plic, src_id, pwm1_isr0, pwm1);
 	if (rc)
 		return 1;
 
 	/* set and select iof for gpio 19-22 */
 	metal_pwm_enable(pwm1);
 	/* set pwmscale, pwmcmp0 to match freq 1Hz */
-	metal_pwm_set_freq(pwm1, 0, 1);
+	metal_pwm_set_freq(pwm1, 0, PWM1_FREQ);
 	/* set pwmcmp1-3 to have pwmcmpxgpio always high */
 	metal_pwm_set_duty(pwm1, 1, 0, METAL_PWM_PHASE_CORRECT_DISABLE);
 	metal_pwm_set_duty(pwm1, 2, 0, METAL_PWM_PHASE_CORRECT_DISABLE);
@@ -85,13 +216,51 @@ int main(void)
 	metal_pwm_trigger(pwm1, 0, METAL_PWM_CONTINUOUS);
 	/* set pwmsticky */
 	metal_pwm_cfg_interrupt(pwm1, METAL_PWM_INTERRUPT_ENABLE);
+#endif
 
 	/* set mstatus.MIE */
 	if (metal_interrupt_enable(cpu_intr, 0))
 		return 1;
-	/* in PLIC enable the source corresponding to pwmcmp0ip */
-	if (metal_interrupt_enable(plic, pwm1_id0))
+
+	int count_intr, count_non_intr;
+	unsigned count_start, intr_count;
+	unsigned tick_count, cycles_per_tick = 0, tick_cycles, src_cycles;
+
+#if GPIO_SOURCES
+	/* machine timer only, its share is taken out below */
+	tick_count = timer_count;
+	count_mcycle(&count_intr, &count_non_intr);
+	tick_count = timer_count - tick_count;
+	if (tick_count)
+		cycles_per_tick = (unsigned)count_intr / tick_count;
+#endif
+
+	/* in PLIC enable the source corresponding to pwmcmp0ip or the pin */
+	if (metal_interrupt_enable(plic, src_id))
 		return 1;
+
+	count_start = isr_count;
+	tick_count = timer_count;
+	count_mcycle(&count_intr, &count_non_intr);
+	tick_count = timer_count - tick_count;
+	intr_count = isr_count - count_start;
+
+	tick_cycles = tick_count * cycles_per_tick;
+	src_cycles = (unsigned)count_intr > tick_cycles ?
+		(unsigned)count_intr - tick_cycles : 0;
+	printf("{\"demo\": \"pwm-interrupt\", \"source\": \"%s\", "
+		"\"freq\": %d, \"intr_count\": %u, \"cycles_per_intr\": %u, "
+		"\"overhead_permille\": %u, \"tick_count\": %u, "
+		"\"cycles_per_tick\": %u, \"nesting_depth\": %d}\r\n",
+#if GPIO_SOURCES
+		"gpio", GPIO_FREQ,
+#else
+		"pwm", PWM1_FREQ,
+#endif
+		intr_count, intr_count ? src_cycles / intr_count : 0,
+		(unsigned)((unsigned long long)src_cycles * 1000 /
+			((unsigned)count_intr + (unsigned)count_non_intr)),
+		tick_count, cycles_per_tick, intr_count ? 1 : 0);
 	
 	while (1) ;
 	return 2;
@@ -4,11 +4,40 @@
  *
  * in external intr handling make a sip pending, see whether it 
  * jumps to soft intr handling.
+ *
+ * The soft intr keeps being taken. Once REENTRY_CYCLES mcycle have
+ * passed since it was pended, the number of soft intr, mcycle per soft
+ * intr and the most handlers seen entered at once are printed as json
+ * for bench-compare.py. Build with -DTRACE_INTR=0 to drop the printf
+ * from the soft intr handler.
+ *
+ * QEMU sifive_e leaves the pwm blocks unimplemented. Built with
+ * -DGPIO_SOURCES=1 the external intr is a rising edge main makes once
+ * on gpio pin 2 (PLIC source 10) instead.
  */
 #include <stdio.h>
 #include <metal/machine.h>
 #include <metal/machine/platform.h>
 
+#ifndef GPIO_SOURCES
+#define GPIO_SOURCES 0
+#endif
+#ifndef REENTRY_CYCLES
+#define REENTRY_CYCLES 10000000
+#endif
+#ifndef TRACE_INTR
+#define TRACE_INTR 1
+#endif
+
+#define GPIO_PIN 2
+
+/* mcycle when the software intr is pended */
+unsigned reentry_start;
+
+/* handlers entered and not returned yet */
+int nesting_depth = 0;
+int nesting_depth_max = 0;
+
 struct metal_cpu *cpu;
 struct metal_interrupt *cpu_intr;
 struct metal_interrupt *plic;
@@ -17,6 +46,10 @@ struct metal_interrupt *clint;
 void my_plic0_handler(int id, void *priv)
 {
 	int rc;
+
+	nesting_depth++;
+	if (nesting_depth > nesting_depth_max)
+		nesting_depth_max = nesting_depth;
 	printf("my_plic0_handler\r\n");
 	
 	volatile unsigned *addr = (unsigned *)0xc200004U;
@@ -30,12 +63,14 @@ void my_plic0_handler(int id, void *priv)
 	
 	printf("pend self a software intr\r\n");
 	volatile unsigned *clint_msip = (unsigned *)0x2000000U;
+	__asm__ volatile("csrr %0, mcycle" : "=r"(reentry_start));
 	*clint_msip = 1;
 
 	printf("here?\r\n");
 
 	/* complete */
 	*addr = val;
+	nesting_depth--;
 }
 
 void my_soft_handler(int id, void *priv)
@@ -43,14 +78,33 @@ void my_soft_handler(int id, void *priv)
 	/* write to 0x2000000 to clear mip.MSIP, but not do so
 	 * since soft intr nested in extern intr is already seen
 	 */
-	static int i;
-	printf(i++ % 60000 == 0 ? "!\r\n" : "");
+	static unsigned i;
+	static int reported = 0;
+	unsigned now;
+
+	nesting_depth++;
+	if (nesting_depth > nesting_depth_max)
+		nesting_depth_max = nesting_depth;
+#if TRACE_INTR
+	printf(i % 60000 == 0 ? "!\r\n" : "");
+#endif
+	i++;
+
+	__asm__ volatile("csrr %0, mcycle" : "=r"(now));
+	if (!reported && now - reentry_start >= REENTRY_CYCLES) {
+		reported = 1;
+		printf("{\"demo\": \"software-and-external-interrupt\", \"source\": \"%s\", "
+			"\"intr_count\": %u, \"cycles_per_intr\": %u, "
+			"\"nesting_depth\": %d}\r\n",
+			GPIO_SOURCES ? "gpio" : "pwm",
+			i, (now - reentry_start) / i, nesting_depth_max);
+	}
+	nesting_depth--;
 }
 
 int main(void)
 {
-	struct metal_pwm *pwm1;
-	int pwm1_id0, rc;
+	int src_id, rc;
 	
 	int i = 0;
 	__asm__ volatile("csrw mcycle, %0" :: "r"(i));
@@ -83,12 +137,32 @@ int main(void)
 	if (metal_interrupt_register_handler(cpu_intr, 3, my_soft_handler, clint))
 		return 1;
 	
+#if GPIO_SOURCES
+	volatile unsigned *gpio_input_en = (unsigned *)0x10012004U;
+	volatile unsigned *gpio_output_en = (unsigned *)0x10012008U;
+	volatile unsigned *gpio_output_val = (unsigned *)0x1001200cU;
+	volatile unsigned *gpio_rise_ie = (unsigned *)0x10012018U;
+	volatile unsigned *gpio_rise_ip = (unsigned *)0x1001201cU;
+
+	/* both input and output so the pin value reads back */
+	*gpio_output_val &= ~(1U << GPIO_PIN);
+	*gpio_input_en |= 1U << GPIO_PIN;
+	*gpio_output_en |= 1U << GPIO_PIN;
+	*gpio_rise_ip = 1U << GPIO_PIN;
+	*gpio_rise_ie |= 1U << GPIO_PIN;
+
+	/* gpio0 is source 8 for PLIC */
+	src_id = 8 + GPIO_PIN;
+#else
+	struct metal_pwm *pwm1;
+
 	pwm1 = metal_pwm_get_device(1);
 	if (pwm1 == NULL)
 		return 1;
-	pwm1_id0 = metal_pwm_get_interrupt_id(pwm1, 0);
+	src_id = metal_pwm_get_interrupt_id(pwm1, 0);
+#endif
 	
-	metal_interrupt_set_priority(plic, pwm1_id0, 2);
+	metal_interrupt_set_priority(plic, src_id, 2);
 	
 	cpu_intr = metal_cpu_interrupt_controller(cpu);
 	if (cpu_intr == NULL)
@@ -97,6 +171,7 @@ int main(void)
 	if (rc)
 		return 1;
 
+#if !GPIO_SOURCES
 	metal_pwm_enable(pwm1);
 	metal_pwm_set_freq(pwm1, 0, 1);
 	metal_pwm_set_duty(pwm1, 1, 0, METAL_PWM_PHASE_CORRECT_DISABLE);
@@ -105,11 +180,16 @@ int main(void)
 
 	metal_pwm_trigger(pwm1, 0, METAL_PWM_CONTINUOUS);
 	metal_pwm_cfg_interrupt(pwm1, METAL_PWM_INTERRUPT_ENABLE);
+#endif
 
 	if (metal_interrupt_enable(cpu_intr, 0))
 		return 1;
-	if (metal_interrupt_enable(plic, pwm1_id0))
+	if (metal_interrupt_enable(plic, src_id))
 		return 1;
+#if GPIO_SOURCES
+	/* rising edge on the pin */
+	*gpio_output_val |= 1U << GPIO_PIN;
+#endif
 	
 	while (1) ;
 	return 2;